@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2025 Maxtek Consulting
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Hyperpage API
+#include <hyperpage.hpp>
+
+// Libevent HTTP client
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+// command line argument parsing
+#include <argparse/argparse.hpp>
+
+// std C++ headers
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using load_clock = std::chrono::steady_clock;
+
+struct load_options
+{
+    std::string host;
+    int port;
+    size_t connections;
+    double rate;     // requests per second, 0 for closed loop
+    double duration; // seconds
+    double exponent; // zipf exponent
+    uint64_t seed;
+    int pid; // server process to sample, 0 to skip
+};
+
+// samples ranks 0..count-1 where rank k has weight 1/(k+1)^exponent
+class zipf_distribution
+{
+public:
+    zipf_distribution(size_t count, double exponent) : _cdf(count)
+    {
+        double total = 0.0;
+        for (size_t rank = 0; rank < count; rank++)
+        {
+            total += 1.0 / std::pow(static_cast<double>(rank + 1), exponent);
+            _cdf[rank] = total;
+        }
+        for (double &value : _cdf)
+        {
+            value /= total;
+        }
+    }
+
+    template <class Generator>
+    size_t operator()(Generator &generator)
+    {
+        const double sample = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+        const auto it = std::lower_bound(_cdf.begin(), _cdf.end(), sample);
+        return std::min(static_cast<size_t>(it - _cdf.begin()), _cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> _cdf;
+};
+
+// user plus system CPU time of a process in seconds, read from procfs
+static std::optional<double> process_cpu_seconds(int pid)
+{
+    std::optional<double> result;
+#ifdef __linux__
+    std::ifstream input("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (pid > 0 && std::getline(input, stat))
+    {
+        // fields after the command name, which is wrapped in parentheses
+        std::istringstream fields(stat.substr(stat.rfind(')') + 2));
+        std::string field;
+        unsigned long long utime = 0;
+        unsigned long long stime = 0;
+        for (int index = 3; index < 14; index++)
+        {
+            fields >> field;
+        }
+        if (fields >> utime >> stime)
+        {
+            result = static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+        }
+    }
+#else
+    (void)pid;
+#endif
+    return result;
+}
+
+class load_generator
+{
+public:
+    load_generator(const load_options &options, std::vector<std::string> urls) : _options(options),
+                                                                                 _urls(std::move(urls)),
+                                                                                 _popularity(_urls.size(), options.exponent),
+                                                                                 _random(options.seed),
+                                                                                 _base(event_base_new(), &event_base_free),
+                                                                                 _tick(nullptr, &event_free),
+                                                                                 _deadline(nullptr, &event_free),
+                                                                                 _grace(nullptr, &event_free),
+                                                                                 _round_robin(0),
+                                                                                 _stopping(false),
+                                                                                 _unreachable(false),
+                                                                                 _outstanding(0),
+                                                                                 _errors(0),
+                                                                                 _non_2xx(0),
+                                                                                 _timeouts(0),
+                                                                                 _bytes(0)
+    {
+        for (size_t index = 0; index < options.connections; index++)
+        {
+            auto conn = std::make_unique<connection>();
+            conn->owner = this;
+            conn->handle.reset(evhttp_connection_base_new(_base.get(), nullptr, options.host.c_str(),
+                                                          static_cast<uint16_t>(options.port)));
+            if (!conn->handle)
+            {
+                throw std::runtime_error("Failed to create connection to " + options.host);
+            }
+            evhttp_connection_set_timeout(conn->handle.get(), 10);
+            _connections.push_back(std::move(conn));
+        }
+        _tick.reset(event_new(_base.get(), -1, EV_PERSIST, handle_tick, this));
+        _deadline.reset(evtimer_new(_base.get(), handle_deadline, this));
+        _grace.reset(evtimer_new(_base.get(), handle_grace, this));
+    }
+
+    void run()
+    {
+        const timeval duration = to_timeval(_options.duration);
+
+        _cpu_start = process_cpu_seconds(_options.pid);
+        _start = load_clock::now();
+        _end = _start;
+        _next = _start;
+        evtimer_add(_deadline.get(), &duration);
+        if (_options.rate > 0.0)
+        {
+            const timeval tick = to_timeval(0.001);
+            evtimer_add(_tick.get(), &tick);
+        }
+        else
+        {
+            for (auto &conn : _connections)
+            {
+                send(*conn, _start);
+            }
+        }
+        event_base_dispatch(_base.get());
+        // requests still in flight after the grace period are abandoned, and
+        // are likely the slowest, so they are reported instead of dropped
+        _timeouts = _outstanding;
+        _cpu_end = process_cpu_seconds(_options.pid);
+        if (_unreachable)
+        {
+            throw std::runtime_error("No response from " + _options.host + ":" + std::to_string(_options.port));
+        }
+    }
+
+    void report(std::ostream &out)
+    {
+        const double elapsed = std::chrono::duration<double>(_end - _start).count();
+        std::sort(_latencies.begin(), _latencies.end());
+        out << std::fixed << std::setprecision(1)
+            << "mode:        " << (_options.rate > 0.0 ? "fixed rate" : "closed loop") << ", "
+            << _connections.size() << " connections, " << _urls.size() << " urls\n"
+            << "requests:    " << _latencies.size() << " (" << _errors << " errors, " << _non_2xx << " non-2xx, "
+            << _timeouts << " timeouts)\n"
+            << "throughput:  " << (elapsed > 0.0 ? _latencies.size() / elapsed : 0.0) << " req/s\n"
+            << "transfer:    " << (elapsed > 0.0 ? _bytes / elapsed / (1024.0 * 1024.0) : 0.0) << " MiB/s\n"
+            << std::setprecision(3)
+            << "latency ms:  p50 " << percentile(0.50) << "  p90 " << percentile(0.90)
+            << "  p99 " << percentile(0.99) << "  p99.9 " << percentile(0.999)
+            << "  max " << percentile(1.0) << "\n";
+        if (_cpu_start && _cpu_end)
+        {
+            out << std::setprecision(1)
+                << "server cpu:  " << (elapsed > 0.0 ? 100.0 * (*_cpu_end - *_cpu_start) / elapsed : 0.0) << " %\n";
+        }
+    }
+
+private:
+    struct connection
+    {
+        load_generator *owner = nullptr;
+        std::unique_ptr<evhttp_connection, decltype(&evhttp_connection_free)> handle{nullptr, &evhttp_connection_free};
+        // evhttp answers requests on a connection in order, so the front
+        // entry always belongs to the next response
+        std::deque<load_clock::time_point> pending;
+    };
+
+    static timeval to_timeval(double seconds)
+    {
+        timeval result;
+        result.tv_sec = static_cast<long>(seconds);
+        result.tv_usec = static_cast<long>((seconds - result.tv_sec) * 1e6);
+        return result;
+    }
+
+    static void handle_response(evhttp_request *req, void *arg)
+    {
+        connection *conn = static_cast<connection *>(arg);
+        conn->owner->complete(*conn, req);
+    }
+
+    static void handle_tick(evutil_socket_t, short, void *arg)
+    {
+        load_generator *self = static_cast<load_generator *>(arg);
+        self->schedule();
+    }
+
+    static void handle_deadline(evutil_socket_t, short, void *arg)
+    {
+        load_generator *self = static_cast<load_generator *>(arg);
+        const timeval grace = to_timeval(2.0);
+        self->_stopping = true;
+        self->_end = load_clock::now();
+        evtimer_del(self->_tick.get());
+        if (self->_outstanding == 0)
+        {
+            event_base_loopbreak(self->_base.get());
+        }
+        else
+        {
+            evtimer_add(self->_grace.get(), &grace);
+        }
+    }
+
+    static void handle_grace(evutil_socket_t, short, void *arg)
+    {
+        load_generator *self = static_cast<load_generator *>(arg);
+        // the run lasted until the generator gave up on the stragglers
+        self->_end = load_clock::now();
+        event_base_loopbreak(self->_base.get());
+    }
+
+    // issues every request whose fixed-rate start time has passed,
+    // measuring latency from that start time to avoid coordinated omission
+    void schedule()
+    {
+        const load_clock::time_point now = load_clock::now();
+        const auto interval = std::chrono::duration_cast<load_clock::duration>(
+            std::chrono::duration<double>(1.0 / _options.rate));
+        while (_next <= now)
+        {
+            send(*_connections[_round_robin++ % _connections.size()], _next);
+            _next += interval;
+        }
+    }
+
+    void send(connection &conn, load_clock::time_point scheduled)
+    {
+        evhttp_request *req = evhttp_request_new(handle_response, &conn);
+        const std::string &url = _urls[_popularity(_random)];
+        evhttp_add_header(evhttp_request_get_output_headers(req), "Host", _options.host.c_str());
+        conn.pending.push_back(scheduled);
+        _outstanding++;
+        if (evhttp_make_request(conn.handle.get(), req, EVHTTP_REQ_GET, url.c_str()) != 0)
+        {
+            // libevent frees the request on failure
+            conn.pending.pop_back();
+            _outstanding--;
+            _errors++;
+        }
+    }
+
+    void complete(connection &conn, evhttp_request *req)
+    {
+        const load_clock::time_point now = load_clock::now();
+        const int code = req ? evhttp_request_get_response_code(req) : 0;
+        const load_clock::time_point scheduled = conn.pending.empty() ? now : conn.pending.front();
+        if (!conn.pending.empty())
+        {
+            conn.pending.pop_front();
+        }
+        _outstanding--;
+
+        if (code == 0)
+        {
+            _errors++;
+        }
+        else
+        {
+            _latencies.push_back(std::chrono::duration<double, std::milli>(now - scheduled).count());
+            _bytes += evbuffer_get_length(evhttp_request_get_input_buffer(req));
+            if (code < 200 || code >= 300)
+            {
+                _non_2xx++;
+            }
+        }
+
+        // responses that arrive after the deadline still count, so the run
+        // is stretched to cover them rather than inflating throughput
+        _end = now;
+        if (!_stopping)
+        {
+            if (code == 0 && _latencies.empty())
+            {
+                // nothing has answered yet, so the server is not reachable
+                _unreachable = true;
+                event_base_loopbreak(_base.get());
+            }
+            else if (_options.rate <= 0.0)
+            {
+                send(conn, now);
+            }
+        }
+        else if (_outstanding == 0)
+        {
+            event_base_loopbreak(_base.get());
+        }
+    }
+
+    double percentile(double fraction) const
+    {
+        double result = 0.0;
+        if (!_latencies.empty())
+        {
+            const size_t rank = static_cast<size_t>(std::ceil(fraction * _latencies.size()));
+            result = _latencies[std::clamp(rank, static_cast<size_t>(1), _latencies.size()) - 1];
+        }
+        return result;
+    }
+
+    load_options _options;
+    std::vector<std::string> _urls;
+    zipf_distribution _popularity;
+    std::mt19937_64 _random;
+    std::unique_ptr<event_base, decltype(&event_base_free)> _base;
+    std::unique_ptr<event, decltype(&event_free)> _tick;
+    std::unique_ptr<event, decltype(&event_free)> _deadline;
+    std::unique_ptr<event, decltype(&event_free)> _grace;
+    std::vector<std::unique_ptr<connection>> _connections;
+    load_clock::time_point _start;
+    load_clock::time_point _end;
+    load_clock::time_point _next;
+    size_t _round_robin;
+    bool _stopping;
+    bool _unreachable;
+    size_t _outstanding;
+    size_t _errors;
+    size_t _non_2xx;
+    size_t _timeouts;
+    size_t _bytes;
+    std::vector<double> _latencies;
+    std::optional<double> _cpu_start;
+    std::optional<double> _cpu_end;
+};
+
+// percent-encodes each segment of a page path so characters such as
+// spaces, '%', '?' and '#' reach the server as part of the path
+static std::string encode_path(const std::string &path)
+{
+    std::string result;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        const size_t end = std::min(path.find('/', start), path.size());
+        char *segment = evhttp_uriencode(path.data() + start, static_cast<ev_ssize_t>(end - start), 0);
+        if (!segment)
+        {
+            throw std::runtime_error("Failed to encode path: " + path);
+        }
+        result.append(segment);
+        std::free(segment);
+        if (end < path.size())
+        {
+            result.push_back('/');
+        }
+        start = end + 1;
+    }
+    return result;
+}
+
+// URLs are ranked by popularity in file order, or in a shuffled order
+// when they are listed from an archive
+static std::vector<std::string> load_urls(const std::string &url_file, const std::string &archive, uint64_t seed)
+{
+    std::vector<std::string> result;
+    if (!url_file.empty())
+    {
+        std::ifstream input(url_file);
+        std::string line;
+        if (!input)
+        {
+            throw std::runtime_error("Failed to open URL file: " + url_file);
+        }
+        while (std::getline(input, line))
+        {
+            if (!line.empty() && line.front() != '#')
+            {
+                result.push_back(encode_path(line));
+            }
+        }
+    }
+    else
+    {
+        if (!std::filesystem::is_regular_file(archive))
+        {
+            throw std::runtime_error("Failed to open archive: " + archive);
+        }
+        hyperpage::reader reader(archive);
+        auto cursor = reader.list();
+        while (cursor->next())
+        {
+            result.push_back(encode_path(cursor->get_path()));
+        }
+        std::mt19937_64 random(seed);
+        std::shuffle(result.begin(), result.end(), random);
+    }
+    if (result.empty())
+    {
+        throw std::runtime_error("No URLs to request");
+    }
+    return result;
+}
+
+static void run(int argc, char *argv[])
+{
+    argparse::ArgumentParser program("loadgen");
+    load_options options;
+
+    program.add_argument("--host")
+        .help("Address of the server")
+        .default_value(std::string("127.0.0.1"));
+    program.add_argument("--port")
+        .help("Port of the server")
+        .default_value(12345)
+        .scan<'i', int>();
+    program.add_argument("-c", "--connections")
+        .help("Number of concurrent connections")
+        .default_value(static_cast<size_t>(16))
+        .scan<'u', size_t>();
+    program.add_argument("-r", "--rate")
+        .help("Requests per second across all connections, 0 for closed loop")
+        .default_value(0.0)
+        .scan<'g', double>();
+    program.add_argument("-d", "--duration")
+        .help("Length of the run in seconds")
+        .default_value(10.0)
+        .scan<'g', double>();
+    program.add_argument("-s", "--zipf")
+        .help("Zipf exponent for URL popularity, 0 for uniform")
+        .default_value(1.0)
+        .scan<'g', double>();
+    program.add_argument("--seed")
+        .help("Seed for URL selection")
+        .default_value(static_cast<uint64_t>(1))
+        .scan<'u', uint64_t>();
+    program.add_argument("-u", "--urls")
+        .help("File listing page paths, one per line and not percent-encoded, most popular first")
+        .default_value(std::string());
+    program.add_argument("-a", "--archive")
+        .help("Hyperpage database to list request paths from when --urls is not given")
+        .default_value((std::filesystem::canonical(argv[0]).parent_path() / "hyperpage.db").string());
+    program.add_argument("-p", "--pid")
+        .help("Server process ID to sample CPU usage from (Linux only)")
+        .default_value(0)
+        .scan<'i', int>();
+
+    program.parse_args(argc, argv);
+
+    options.host = program.get<std::string>("--host");
+    options.port = program.get<int>("--port");
+    options.connections = std::max(program.get<size_t>("--connections"), static_cast<size_t>(1));
+    options.rate = program.get<double>("--rate");
+    options.duration = program.get<double>("--duration");
+    options.exponent = program.get<double>("--zipf");
+    options.seed = program.get<uint64_t>("--seed");
+    options.pid = program.get<int>("--pid");
+
+    load_generator generator(options, load_urls(program.get<std::string>("--urls"),
+                                                program.get<std::string>("--archive"),
+                                                options.seed));
+    generator.run();
+    generator.report(std::cout);
+}
+
+int main(int argc, char *argv[])
+{
+    int exit_code(0);
+#ifdef _WIN32
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+    try
+    {
+        run(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        exit_code = 1;
+    }
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return exit_code;
+}
@@ -39,9 +39,11 @@ public:
     server(const std::string &dbpath) : _base(event_base_new(), &event_base_free),
                                         _http(evhttp_new(_base.get()), &evhttp_free)
     {
+        hyperpage::resolve_options options;
+        options.fallback = "/index.html"; // let the React app handle client-side routes
         _reader = std::make_unique<hyperpage::reader>(dbpath);
+        _reader->configure(options);
         evhttp_bind_socket(_http.get(), "0.0.0.0", 12345);
-        evhttp_set_cb(_http.get(), "/", handle_index, this);
         evhttp_set_gencb(_http.get(), handle_request, this);
     }
 
@@ -62,15 +64,9 @@ private:
         self->load_page(req, evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)));
     }
 
-    static void handle_index(struct evhttp_request *req, void *arg)
-    {
-        server *self = static_cast<server *>(arg);
-        self->load_page(req, "/index.html");
-    }
-
     void load_page(struct evhttp_request *req, const std::string &path)
     {
-        auto page = _reader->load(path);
+        auto page = _reader->resolve(path);
         if (page)
         {
             evhttp_add_header(req->output_headers, "Content-Type", page->get_mime_type().c_str());
@@ -32,6 +32,10 @@
 // filesystem operations
 #include <filesystem>
 
+// parallel shard writing
+#include <exception>
+#include <thread>
+
 class mapped_page : public hyperpage::page
 {
 public:
@@ -47,9 +51,17 @@ private:
     std::unique_ptr<mio::basic_mmap<mio::access_mode::read, uint8_t>> _mmap;
 };
 
+// pairs of base directory and file path, in command line order
+using file_list = std::vector<std::pair<std::filesystem::path, std::filesystem::path>>;
+
 static void run(int argc, char *argv[]);
-static void write_directory_to_file(const std::string &directory,
-                                    std::unique_ptr<hyperpage::writer> &writer);
+static void run_pack(const argparse::ArgumentParser &command);
+static void run_diff(const argparse::ArgumentParser &command);
+static void run_apply(const argparse::ArgumentParser &command);
+static std::string page_path(const std::filesystem::path &base, const std::filesystem::path &path);
+static void collect_directory(const std::string &directory, file_list &files);
+static void write_files(const file_list &files, hyperpage::writer &writer);
+static void write_sharded(const file_list &files, hyperpage::sharded_writer &writer);
 
 int main(int argc, char *argv[])
 {
@@ -68,8 +80,7 @@ int main(int argc, char *argv[])
 
 mapped_page::mapped_page(const std::filesystem::path &base, const std::filesystem::path &path)
 {
-    _path = std::filesystem::relative(path, base).generic_string();
-    _path.insert(0, "/"); // Ensure it starts with a slash for web paths
+    _path = page_path(base, path);
     _mime_type = hyperpage::mime_type(path.filename().string());
     _mmap = std::make_unique<mio::basic_mmap<mio::access_mode::read, uint8_t>>(path.string());
 }
@@ -94,7 +105,14 @@ size_t mapped_page::get_length() const
     return _mmap->length();
 }
 
-void write_directory_to_file(const std::string &directory, std::unique_ptr<hyperpage::writer> &writer)
+std::string page_path(const std::filesystem::path &base, const std::filesystem::path &path)
+{
+    std::string result = std::filesystem::relative(path, base).generic_string();
+    result.insert(0, "/"); // Ensure it starts with a slash for web paths
+    return result;
+}
+
+void collect_directory(const std::string &directory, file_list &files)
 {
     if (!std::filesystem::exists(directory))
     {
@@ -110,37 +128,205 @@ void write_directory_to_file(const std::string &directory, std::unique_ptr<hyper
     {
         if (entry.is_regular_file())
         {
-            mapped_page page(directory, entry.path());
-            writer->store(page);
+            files.emplace_back(directory, entry.path());
+        }
+    }
+}
+
+void write_files(const file_list &files, hyperpage::writer &writer)
+{
+    // one transaction for the whole set instead of one per file
+    writer.begin();
+    try
+    {
+        for (const auto &file : files)
+        {
+            mapped_page page(file.first, file.second);
+            writer.store(page);
+        }
+        writer.commit();
+    }
+    catch (...)
+    {
+        writer.rollback();
+        throw;
+    }
+}
+
+void write_sharded(const file_list &files, hyperpage::sharded_writer &writer)
+{
+    // each shard is an independent database, so shards are written in
+    // parallel while files within a shard keep their command line order
+    std::vector<file_list> buckets(writer.shard_count());
+    std::vector<std::exception_ptr> errors(writer.shard_count());
+    std::vector<std::thread> workers;
+    for (const auto &file : files)
+    {
+        buckets[writer.shard_of(page_path(file.first, file.second))].push_back(file);
+    }
+    for (size_t index = 0; index < buckets.size(); index++)
+    {
+        workers.emplace_back([&, index]()
+                             {
+                                 try
+                                 {
+                                     write_files(buckets[index], writer.shard(index));
+                                     writer.close(index);
+                                 }
+                                 catch (...)
+                                 {
+                                     errors[index] = std::current_exception();
+                                 } });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    for (const std::exception_ptr &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
         }
     }
+    writer.finish();
 }
 
 void run(int argc, char *argv[])
 {
     argparse::ArgumentParser program("hyperpack");
-    std::unique_ptr<hyperpage::writer> writer;
+    argparse::ArgumentParser pack_command("pack");
+    argparse::ArgumentParser diff_command("diff");
+    argparse::ArgumentParser apply_command("apply");
 
-    program.add_argument("directories")
+    pack_command.add_description("Pack directories into a hyperpage database");
+    pack_command.add_argument("directories")
         .help("Directories to scan for files to pack into the hyperpage database")
         .nargs(argparse::nargs_pattern::at_least_one)
         .required();
-    program.add_argument("-o", "--output")
+    pack_command.add_argument("-o", "--output")
         .help("Output file for the hyperpage database")
         .default_value("hyperpage.db");
-    program.add_argument("-v", "--verbose")
+    pack_command.add_argument("-s", "--shards")
+        .help("Split the archive into N shard databases, making the output file a manifest")
+        .default_value(static_cast<size_t>(1))
+        .scan<'u', size_t>();
+    pack_command.add_argument("--shard-by")
+        .help("Assign files to shards by \"hash\" of their path or by top-level \"directory\"")
+        .default_value(std::string("hash"));
+    pack_command.add_argument("-m", "--mime")
+        .help("Override the MIME type for a file extension, e.g. --mime md=text/plain")
+        .default_value(std::vector<std::string>{})
+        .append();
+    pack_command.add_argument("-v", "--verbose")
         .help("Show detailed output information")
         .default_value(false)
         .implicit_value(true);
+
+    diff_command.add_description("Create a patch from the differences between two hyperpage databases");
+    diff_command.add_argument("old")
+        .help("Original hyperpage database");
+    diff_command.add_argument("new")
+        .help("Updated hyperpage database");
+    diff_command.add_argument("-o", "--output")
+        .help("Output file for the patch")
+        .default_value("hyperpage.patch");
+
+    apply_command.add_description("Apply a patch to an existing hyperpage database");
+    apply_command.add_argument("patch")
+        .help("Patch created by hyperpack diff");
+    apply_command.add_argument("database")
+        .help("Hyperpage database to update");
+
+    program.add_subparser(pack_command);
+    program.add_subparser(diff_command);
+    program.add_subparser(apply_command);
+
+    // packing predates the subcommands, so anything that does not name
+    // one is parsed as pack to keep "hyperpack -o out.db dir..." working
+    std::vector<std::string> arguments(argv, argv + argc);
+    if (arguments.size() > 1 && arguments[1] != "pack" && arguments[1] != "diff" && arguments[1] != "apply" &&
+        arguments[1] != "-h" && arguments[1] != "--help")
+    {
+        arguments.insert(arguments.begin() + 1, "pack");
+    }
+    program.parse_args(arguments);
+
+    if (program.is_subcommand_used(pack_command))
+    {
+        run_pack(pack_command);
+    }
+    else if (program.is_subcommand_used(diff_command))
+    {
+        run_diff(diff_command);
+    }
+    else if (program.is_subcommand_used(apply_command))
+    {
+        run_apply(apply_command);
+    }
+    else
+    {
+        std::cerr << program;
+        throw std::runtime_error("A command is required");
+    }
+}
+
+void run_diff(const argparse::ArgumentParser &command)
+{
+    hyperpage::diff(command.get<std::string>("old"),
+                    command.get<std::string>("new"),
+                    command.get<std::string>("--output"));
+}
+
+void run_apply(const argparse::ArgumentParser &command)
+{
+    const std::string database = command.get<std::string>("database");
+    if (!std::filesystem::is_regular_file(database))
+    {
+        throw std::runtime_error("Failed to open database: " + database);
+    }
+    hyperpage::writer writer(database);
+    hyperpage::apply(command.get<std::string>("patch"), writer);
+}
+
+void run_pack(const argparse::ArgumentParser &command)
+{
+    file_list files;
+
+    for (const std::string &mapping : command.get<std::vector<std::string>>("--mime"))
+    {
+        const size_t separator = mapping.find('=');
+        if (separator == std::string::npos || separator == mapping.size() - 1)
+        {
+            throw std::runtime_error("Invalid MIME mapping: " + mapping);
+        }
+        hyperpage::set_mime_type(mapping.substr(0, separator), mapping.substr(separator + 1));
+    }
     
-    program.parse_args(argc, argv);
-    
-    auto output_file = program.get<std::string>("--output");
-    writer = std::make_unique<hyperpage::writer>(output_file);
-    std::vector<std::string> directories = program.get<std::vector<std::string>>("directories");
+    auto output_file = command.get<std::string>("--output");
+    auto shards = command.get<size_t>("--shards");
+    auto shard_by = command.get<std::string>("--shard-by");
+    if (shard_by != "hash" && shard_by != "directory")
+    {
+        throw std::runtime_error("Invalid shard assignment: " + shard_by);
+    }
+
+    std::vector<std::string> directories = command.get<std::vector<std::string>>("directories");
     std::for_each(directories.begin(), directories.end(), [&](const auto &directory)
                                                           {
-                                                              write_directory_to_file(directory,
-                                                                                      writer);
+                                                              collect_directory(directory, files);
                                                           });
+
+    if (shards > 1)
+    {
+        hyperpage::sharded_writer writer(output_file, shards,
+                                         shard_by == "directory" ? hyperpage::shard_strategy::top_directory
+                                                                 : hyperpage::shard_strategy::path_hash);
+        write_sharded(files, writer);
+    }
+    else
+    {
+        hyperpage::writer writer(output_file);
+        write_files(files, writer);
+    }
 }
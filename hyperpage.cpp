@@ -28,6 +28,18 @@ extern "C"
 #include <MegaMimes.h>
 }
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
 static sqlite3 *get_handle(std::unique_ptr<void, std::function<void(void *)>> &handle)
 {
     return static_cast<sqlite3 *>(handle.get());
@@ -51,6 +63,197 @@ static inline bool sqlite_call(int expected, Func func, Args... args) noexcept
     return rc == expected;
 }
 
+static constexpr uint64_t fnv1a_offset = 14695981039346656037ull;
+
+// FNV-1a is used instead of std::hash so shard assignment and patch
+// fingerprints are stable across platforms and standard library
+// implementations; passing a previous result continues the hash
+static uint64_t fnv1a_hash(std::string_view key, uint64_t hash = fnv1a_offset)
+{
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+struct mime_entry
+{
+    std::string_view extension;
+    std::string_view mime_type;
+};
+
+static constexpr std::string_view default_mime_type = "application/octet-stream";
+
+// common web types, sorted by extension for binary search (see the
+// static_assert below); anything else falls back to MegaMimes
+static constexpr std::array<mime_entry, 80> mime_table = {{
+    {"3gp", "video/3gpp"},
+    {"7z", "application/x-7z-compressed"},
+    {"aac", "audio/aac"},
+    {"apng", "image/apng"},
+    {"atom", "application/atom+xml"},
+    {"avi", "video/x-msvideo"},
+    {"avif", "image/avif"},
+    {"bin", "application/octet-stream"},
+    {"bmp", "image/bmp"},
+    {"bz2", "application/x-bzip2"},
+    {"cjs", "text/javascript"},
+    {"css", "text/css"},
+    {"csv", "text/csv"},
+    {"doc", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"epub", "application/epub+zip"},
+    {"flac", "audio/flac"},
+    {"gif", "image/gif"},
+    {"gz", "application/gzip"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"ico", "image/x-icon"},
+    {"ics", "text/calendar"},
+    {"jar", "application/java-archive"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "text/javascript"},
+    {"json", "application/json"},
+    {"jsonld", "application/ld+json"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"m4a", "audio/mp4"},
+    {"m4v", "video/mp4"},
+    {"map", "application/json"},
+    {"md", "text/markdown"},
+    {"mid", "audio/midi"},
+    {"midi", "audio/midi"},
+    {"mjs", "text/javascript"},
+    {"mov", "video/quicktime"},
+    {"mp3", "audio/mpeg"},
+    {"mp4", "video/mp4"},
+    {"mpd", "application/dash+xml"},
+    {"mpeg", "video/mpeg"},
+    {"oga", "audio/ogg"},
+    {"ogg", "audio/ogg"},
+    {"ogv", "video/ogg"},
+    {"opus", "audio/opus"},
+    {"otf", "font/otf"},
+    {"pdf", "application/pdf"},
+    {"png", "image/png"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"rar", "application/vnd.rar"},
+    {"rss", "application/rss+xml"},
+    {"rtf", "application/rtf"},
+    {"sh", "application/x-sh"},
+    {"svg", "image/svg+xml"},
+    {"tar", "application/x-tar"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"toml", "application/toml"},
+    {"ts", "video/mp2t"},
+    {"ttf", "font/ttf"},
+    {"txt", "text/plain"},
+    {"vtt", "text/vtt"},
+    {"wasm", "application/wasm"},
+    {"wav", "audio/wav"},
+    {"weba", "audio/webm"},
+    {"webm", "video/webm"},
+    {"webmanifest", "application/manifest+json"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"xhtml", "application/xhtml+xml"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"xml", "application/xml"},
+    {"yaml", "application/yaml"},
+    {"yml", "application/yaml"},
+    {"zip", "application/zip"}
+}};
+
+static constexpr bool mime_table_sorted()
+{
+    for (size_t i = 1; i < mime_table.size(); i++)
+    {
+        if (!(mime_table[i - 1].extension < mime_table[i].extension))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(mime_table_sorted(), "mime_table must be sorted by extension");
+
+struct mime_registry
+{
+    std::atomic<bool> active{false};
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, std::string_view> overrides;
+    // extensions MegaMimes recognized; misses are not cached, so the cache
+    // is bounded by the MegaMimes table however many unknown extensions
+    // are looked up
+    std::unordered_map<std::string, std::string_view> fallbacks;
+    std::unordered_set<std::string> interned;
+};
+
+static mime_registry &get_mime_registry()
+{
+    static mime_registry registry;
+    return registry;
+}
+
+static std::string_view fallback_mime_type(const std::string &extension)
+{
+    mime_registry &registry = get_mime_registry();
+    std::string_view result = default_mime_type;
+    bool cached = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(registry.mutex);
+        auto it = registry.fallbacks.find(extension);
+        if (it != registry.fallbacks.end())
+        {
+            result = it->second;
+            cached = true;
+        }
+    }
+    if (!cached)
+    {
+        const std::string file_name = "file." + extension;
+        const char *mime = getMegaMimeType(file_name.c_str());
+        if (mime)
+        {
+            std::unique_lock<std::shared_mutex> lock(registry.mutex);
+            result = *registry.interned.insert(mime).first;
+            registry.fallbacks.emplace(extension, result);
+        }
+    }
+    return result;
+}
+
+static std::string_view file_extension(std::string_view path)
+{
+    std::string_view result;
+    const size_t dot = path.find_last_of('.');
+    if (dot != std::string_view::npos)
+    {
+        const size_t separator = path.find_last_of("/\\");
+        if (separator == std::string_view::npos || separator < dot)
+        {
+            result = path.substr(dot + 1);
+        }
+    }
+    return result;
+}
+
+static std::string normalize_extension(std::string_view extension)
+{
+    std::string result(extension);
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+    return result;
+}
+
 class stored_page : public hyperpage::page
 {
 public:
@@ -60,7 +263,7 @@ public:
         sqlite3_stmt *stmt = nullptr;
         sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
         _stmt.reset(stmt);
-        sqlite3_bind_text(_stmt.get(), 1, _path.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(_stmt.get(), 1, _path.c_str(), static_cast<int>(_path.size()), SQLITE_STATIC);
 
         if (sqlite_call(SQLITE_ROW, sqlite3_step, _stmt.get()))
         {
@@ -105,7 +308,18 @@ private:
     size_t _length;
 };
 
-hyperpage::reader::reader(const std::string &db_path) : _handle(nullptr, close_handle<false>)
+struct route_table
+{
+    std::unordered_map<std::string, std::string> routes;
+    std::string fallback;
+};
+
+static void delete_routes(void *routes)
+{
+    delete static_cast<route_table *>(routes);
+}
+
+hyperpage::reader::reader(const std::string &db_path) : _handle(nullptr, close_handle<false>), _routes(nullptr, delete_routes)
 {
     sqlite3 *db = nullptr;
     if (!sqlite_call(SQLITE_OK, sqlite3_open, db_path.c_str(), &db))
@@ -126,6 +340,275 @@ std::unique_ptr<hyperpage::page> hyperpage::reader::load(const std::string &page
     return result;
 }
 
+std::unique_ptr<hyperpage::cursor> hyperpage::reader::list(const std::string &prefix)
+{
+    return std::unique_ptr<hyperpage::cursor>(new hyperpage::cursor(get_handle(_handle), prefix));
+}
+
+static int hex_value(char c)
+{
+    int result = -1;
+    if (c >= '0' && c <= '9')
+    {
+        result = c - '0';
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+        result = c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F')
+    {
+        result = c - 'A' + 10;
+    }
+    return result;
+}
+
+// percent-decodes the path and removes empty, "." and ".." segments along
+// with any trailing slash, so "/a//b/../c/" becomes "/a/c"; a path holding
+// a control byte, such as a decoded "%00", cannot name a page and yields
+// an empty string
+static std::string normalize_path(std::string_view request_path)
+{
+    std::string decoded;
+    std::string result;
+    request_path = request_path.substr(0, request_path.find_first_of("?#"));
+    decoded.reserve(request_path.size());
+    for (size_t index = 0; index < request_path.size(); index++)
+    {
+        const bool escaped = request_path[index] == '%' && index + 2 < request_path.size();
+        const int high = escaped ? hex_value(request_path[index + 1]) : -1;
+        const int low = escaped ? hex_value(request_path[index + 2]) : -1;
+        if (high >= 0 && low >= 0)
+        {
+            decoded.push_back(static_cast<char>(high * 16 + low));
+            index += 2;
+        }
+        else
+        {
+            decoded.push_back(request_path[index]);
+        }
+        if (static_cast<unsigned char>(decoded.back()) < 0x20 || decoded.back() == 0x7F)
+        {
+            return std::string();
+        }
+    }
+
+    size_t start = 0;
+    while (start < decoded.size())
+    {
+        size_t end = decoded.find('/', start);
+        end = end == std::string::npos ? decoded.size() : end;
+        const std::string_view segment = std::string_view(decoded).substr(start, end - start);
+        if (segment == "..")
+        {
+            result.erase(std::min(result.size(), result.find_last_of('/')));
+        }
+        else if (!segment.empty() && segment != ".")
+        {
+            result.push_back('/');
+            result.append(segment);
+        }
+        start = end + 1;
+    }
+    return result.empty() ? "/" : result;
+}
+
+static bool page_exists(sqlite3 *db, const std::string &page_path)
+{
+    const std::string query = "SELECT 1 FROM hyperpage WHERE path = ?;";
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+    sqlite3_bind_text(stmt, 1, page_path.c_str(), static_cast<int>(page_path.size()), SQLITE_STATIC);
+    const bool result = sqlite_call(SQLITE_ROW, sqlite3_step, stmt);
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+void hyperpage::reader::configure(const resolve_options &options)
+{
+    sqlite3 *db = get_handle(_handle);
+    auto table = std::make_unique<route_table>();
+    const std::string index_suffix = options.index_file.empty() ? std::string() : "/" + options.index_file;
+    const std::string html_suffix = options.html_extension ? ".html" : std::string();
+
+    // only paths are selected, so sqlite walks the path index without
+    // reading any content
+    const std::string query = "SELECT path FROM hyperpage "
+                              "WHERE substr(path, -length(?1)) = ?1 OR substr(path, -length(?2)) = ?2;";
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> candidates(stmt, &sqlite3_finalize);
+    if (!index_suffix.empty())
+    {
+        sqlite3_bind_text(stmt, 1, index_suffix.c_str(), -1, SQLITE_STATIC);
+    }
+    if (!html_suffix.empty())
+    {
+        sqlite3_bind_text(stmt, 2, html_suffix.c_str(), -1, SQLITE_STATIC);
+    }
+    while (sqlite_call(SQLITE_ROW, sqlite3_step, stmt))
+    {
+        const std::string path = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        const std::string_view route(path);
+        // index files take precedence over .html pages for the same route
+        if (!index_suffix.empty() && route.size() >= index_suffix.size() &&
+            route.substr(route.size() - index_suffix.size()) == index_suffix)
+        {
+            table->routes[normalize_path(route.substr(0, route.size() - index_suffix.size()))] = path;
+        }
+        else if (!html_suffix.empty() && route.size() > html_suffix.size())
+        {
+            table->routes.emplace(normalize_path(route.substr(0, route.size() - html_suffix.size())), path);
+        }
+    }
+    candidates.reset();
+    table->routes.erase(std::string());
+
+    // derived routes never hide a page stored under the same path
+    for (auto it = table->routes.begin(); it != table->routes.end();)
+    {
+        it = page_exists(db, it->first) ? table->routes.erase(it) : std::next(it);
+    }
+
+    if (!options.fallback.empty())
+    {
+        const std::string fallback = normalize_path(options.fallback);
+        auto it = table->routes.find(fallback);
+        if (it != table->routes.end())
+        {
+            table->fallback = it->second;
+        }
+        else if (page_exists(db, fallback))
+        {
+            table->fallback = fallback;
+        }
+    }
+    _routes.reset(table.release());
+}
+
+std::unique_ptr<hyperpage::page> hyperpage::reader::resolve(const std::string &request_path)
+{
+    const route_table *table = static_cast<const route_table *>(_routes.get());
+    if (!table)
+    {
+        throw std::runtime_error("Reader must be configured before resolving paths");
+    }
+    const std::string path = normalize_path(request_path);
+    std::unique_ptr<hyperpage::page> result;
+    if (!path.empty())
+    {
+        auto it = table->routes.find(path);
+        result = load(it != table->routes.end() ? it->second : path);
+        if (!result && !table->fallback.empty() && file_extension(path).empty())
+        {
+            result = load(table->fallback);
+        }
+    }
+    return result;
+}
+
+// smallest string greater than every string starting with prefix, or an
+// empty string if there is no such bound
+static std::string prefix_upper_bound(std::string prefix)
+{
+    while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xFF)
+    {
+        prefix.pop_back();
+    }
+    if (!prefix.empty())
+    {
+        prefix.back() = static_cast<char>(static_cast<unsigned char>(prefix.back()) + 1);
+    }
+    return prefix;
+}
+
+hyperpage::cursor::cursor(void *db, const std::string &prefix) : _db(db), _stmt(nullptr, [](void *stmt)
+                                                                                   { sqlite3_finalize(static_cast<sqlite3_stmt *>(stmt)); }),
+                                                                 _length(0)
+{
+    // the bounds let sqlite walk the path index as a range scan
+    const std::string upper_bound = prefix_upper_bound(prefix);
+    const std::string query = upper_bound.empty() ? "SELECT path, mime_type, length(content) FROM hyperpage "
+                                                    "WHERE path >= ? ORDER BY path;"
+                                                  : "SELECT path, mime_type, length(content) FROM hyperpage "
+                                                    "WHERE path >= ? AND path < ? ORDER BY path;";
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(static_cast<sqlite3 *>(db), query.c_str(), -1, &stmt, nullptr);
+    _stmt.reset(stmt);
+    sqlite3_bind_text(stmt, 1, prefix.c_str(), -1, SQLITE_TRANSIENT);
+    if (!upper_bound.empty())
+    {
+        sqlite3_bind_text(stmt, 2, upper_bound.c_str(), -1, SQLITE_TRANSIENT);
+    }
+}
+
+bool hyperpage::cursor::next()
+{
+    sqlite3_stmt *stmt = static_cast<sqlite3_stmt *>(_stmt.get());
+    const bool result = sqlite_call(SQLITE_ROW, sqlite3_step, stmt);
+    if (result)
+    {
+        const unsigned char *mime_type = sqlite3_column_text(stmt, 1);
+        _path = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        _mime_type = mime_type ? reinterpret_cast<const char *>(mime_type) : "";
+        _length = static_cast<size_t>(sqlite3_column_int64(stmt, 2));
+    }
+    else
+    {
+        _path.clear();
+        _mime_type.clear();
+        _length = 0;
+    }
+    return result;
+}
+
+const std::string &hyperpage::cursor::get_path() const
+{
+    return _path;
+}
+
+const std::string &hyperpage::cursor::get_mime_type() const
+{
+    return _mime_type;
+}
+
+size_t hyperpage::cursor::get_length() const
+{
+    return _length;
+}
+
+std::unique_ptr<hyperpage::page> hyperpage::cursor::load() const
+{
+    std::unique_ptr<hyperpage::page> result;
+    std::unique_ptr<stored_page> page(new stored_page(static_cast<sqlite3 *>(_db), _path));
+    if (page->found())
+    {
+        result.reset(page.release());
+    }
+    return result;
+}
+
+static const char *const create_schema_query =
+    "CREATE TABLE IF NOT EXISTS hyperpage ("
+    "path TEXT PRIMARY KEY, "
+    "mime_type TEXT, "
+    "content BLOB);"
+    "CREATE UNIQUE INDEX IF NOT EXISTS path_index ON hyperpage (path);";
+
+static const char *const store_page_query =
+    "INSERT INTO hyperpage (path, mime_type, content) VALUES (?, ?, ?) "
+    "ON CONFLICT(path) DO UPDATE SET mime_type=excluded.mime_type, content=excluded.content;";
+
+static bool store_page(sqlite3_stmt *stmt, const hyperpage::page &page)
+{
+    sqlite3_bind_text(stmt, 1, page.get_path().c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, page.get_mime_type().c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_blob(stmt, 3, page.get_content(), static_cast<int>(page.get_length()), SQLITE_STATIC);
+    const bool result = sqlite_call(SQLITE_DONE, sqlite3_step, stmt);
+    sqlite3_reset(stmt);
+    return result;
+}
+
 hyperpage::writer::writer(const std::string &db_path) : _handle(nullptr, close_handle<true>)
 {
     sqlite3 *db = nullptr;
@@ -133,34 +616,511 @@ hyperpage::writer::writer(const std::string &db_path) : _handle(nullptr, close_h
     {
         throw std::runtime_error("Failed to open database: " + db_path);
     }
-    const std::string create_table_query =
-        "CREATE TABLE IF NOT EXISTS hyperpage ("
-        "path TEXT PRIMARY KEY, "
-        "mime_type TEXT, "
-        "content BLOB);"
-        "CREATE UNIQUE INDEX IF NOT EXISTS path_index ON hyperpage (path);";
-    sqlite3_exec(db, create_table_query.c_str(), nullptr, nullptr, nullptr);
+    sqlite3_exec(db, create_schema_query, nullptr, nullptr, nullptr);
     _handle.reset(db);
 }
 
 void hyperpage::writer::store(const hyperpage::page &page)
 {
     sqlite3 *db = get_handle(_handle);
-    const std::string query = 
-        "INSERT INTO hyperpage (path, mime_type, content) VALUES (?, ?, ?) "
-        "ON CONFLICT(path) DO UPDATE SET mime_type=excluded.mime_type, content=excluded.content;";
+    sqlite3_stmt *stmt = nullptr;
+
+    sqlite3_prepare_v2(db, store_page_query, -1, &stmt, nullptr);
+    const bool stored = store_page(stmt, page);
+    sqlite3_finalize(stmt);
+    if (!stored)
+    {
+        throw std::runtime_error("Failed to store page: " + page.get_path());
+    }
+}
+
+void hyperpage::writer::remove(const std::string &page_path)
+{
+    sqlite3 *db = get_handle(_handle);
+    const std::string query = "DELETE FROM hyperpage WHERE path = ?;";
     sqlite3_stmt *stmt = nullptr;
 
     sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, page.get_path().c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, page.get_mime_type().c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_blob(stmt, 3, page.get_content(), static_cast<int>(page.get_length()), SQLITE_STATIC);
-    sqlite3_step(stmt);
+    sqlite3_bind_text(stmt, 1, page_path.c_str(), -1, SQLITE_STATIC);
+    const bool removed = sqlite_call(SQLITE_DONE, sqlite3_step, stmt);
+    sqlite3_finalize(stmt);
+    if (!removed)
+    {
+        throw std::runtime_error("Failed to remove page: " + page_path);
+    }
+}
+
+void hyperpage::writer::begin()
+{
+    if (!sqlite_call(SQLITE_OK, sqlite3_exec, get_handle(_handle), "BEGIN;", nullptr, nullptr, nullptr))
+    {
+        throw std::runtime_error("Failed to begin transaction");
+    }
+}
+
+void hyperpage::writer::commit()
+{
+    if (!sqlite_call(SQLITE_OK, sqlite3_exec, get_handle(_handle), "COMMIT;", nullptr, nullptr, nullptr))
+    {
+        throw std::runtime_error("Failed to commit transaction");
+    }
+}
+
+void hyperpage::writer::rollback()
+{
+    sqlite3 *db = get_handle(_handle);
+    if (!sqlite3_get_autocommit(db))
+    {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    }
+}
+
+// adds one page to the fingerprint of an archive; pages must be added in
+// path order
+static uint64_t fingerprint_page(uint64_t hash, const std::string &path, const std::string &mime_type, size_t length)
+{
+    const std::string entry = path + '\0' + mime_type + '\0' + std::to_string(length) + '\n';
+    return fnv1a_hash(entry, hash);
+}
+
+static std::string fingerprint_string(uint64_t hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result(16, '0');
+    for (size_t index = result.size(); index > 0; index--)
+    {
+        result[index - 1] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+    return result;
+}
+
+static std::string archive_fingerprint(sqlite3 *db)
+{
+    const std::string query = "SELECT path, mime_type, length(content) FROM hyperpage ORDER BY path;";
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> pages(stmt, &sqlite3_finalize);
+    uint64_t hash = fnv1a_offset;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        const unsigned char *mime_type = sqlite3_column_text(stmt, 1);
+        hash = fingerprint_page(hash, reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
+                                mime_type ? reinterpret_cast<const char *>(mime_type) : "",
+                                static_cast<size_t>(sqlite3_column_int64(stmt, 2)));
+    }
+    if (rc != SQLITE_DONE)
+    {
+        throw std::runtime_error("Failed to read database");
+    }
+    return fingerprint_string(hash);
+}
+
+static std::unique_ptr<sqlite3, decltype(&sqlite3_close)> open_patch(const std::string &patch_path)
+{
+    sqlite3 *db = nullptr;
+    const bool opened = sqlite_call(SQLITE_OK, sqlite3_open, patch_path.c_str(), &db);
+    std::unique_ptr<sqlite3, decltype(&sqlite3_close)> result(db, &sqlite3_close);
+    if (!opened)
+    {
+        throw std::runtime_error("Failed to open patch: " + patch_path);
+    }
+    return result;
+}
+
+static bool same_page(const hyperpage::cursor &old_page, const hyperpage::cursor &new_page)
+{
+    bool result = old_page.get_mime_type() == new_page.get_mime_type() && old_page.get_length() == new_page.get_length();
+    if (result && new_page.get_length() > 0)
+    {
+        // metadata matches, so fall back to comparing content
+        auto old_content = old_page.load();
+        auto new_content = new_page.load();
+        result = old_content && new_content &&
+                 std::memcmp(old_content->get_content(), new_content->get_content(), new_page.get_length()) == 0;
+    }
+    return result;
+}
+
+static void write_patch(const std::string &old_db_path, const std::string &new_db_path, const std::string &patch_path)
+{
+    hyperpage::reader old_reader(old_db_path);
+    hyperpage::reader new_reader(new_db_path);
+    auto db = open_patch(patch_path);
+    const std::string schema = std::string(create_schema_query) +
+                               "CREATE TABLE IF NOT EXISTS hyperpage_removed (path TEXT PRIMARY KEY);"
+                               "CREATE TABLE IF NOT EXISTS hyperpage_base (fingerprint TEXT NOT NULL);";
+    if (!sqlite_call(SQLITE_OK, sqlite3_exec, db.get(), schema.c_str(), nullptr, nullptr, nullptr))
+    {
+        throw std::runtime_error("Failed to write patch: " + patch_path);
+    }
+
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db.get(), store_page_query, -1, &stmt, nullptr);
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> store(stmt, &sqlite3_finalize);
+    sqlite3_prepare_v2(db.get(), "INSERT INTO hyperpage_removed (path) VALUES (?);", -1, &stmt, nullptr);
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> remove(stmt, &sqlite3_finalize);
+
+    auto old_cursor = old_reader.list();
+    auto new_cursor = new_reader.list();
+    bool old_valid = old_cursor->next();
+    bool new_valid = new_cursor->next();
+    uint64_t base_hash = fnv1a_offset;
+
+    // the whole patch is written in one transaction; an exception leaves it
+    // uncommitted and the caller discards the file
+    if (!sqlite_call(SQLITE_OK, sqlite3_exec, db.get(), "BEGIN;", nullptr, nullptr, nullptr))
+    {
+        throw std::runtime_error("Failed to write patch: " + patch_path);
+    }
+
+    // both cursors walk in path order, so a single merge pass finds
+    // every added, changed and removed page
+    while (old_valid || new_valid)
+    {
+        const int order = !old_valid   ? 1
+                          : !new_valid ? -1
+                                       : old_cursor->get_path().compare(new_cursor->get_path());
+        bool written = true;
+        if (order <= 0)
+        {
+            // the merge visits every old page in path order, which is all
+            // the fingerprint of the base archive needs
+            base_hash = fingerprint_page(base_hash, old_cursor->get_path(), old_cursor->get_mime_type(), old_cursor->get_length());
+        }
+        if (order < 0)
+        {
+            sqlite3_bind_text(remove.get(), 1, old_cursor->get_path().c_str(), -1, SQLITE_STATIC);
+            written = sqlite_call(SQLITE_DONE, sqlite3_step, remove.get());
+            sqlite3_reset(remove.get());
+            old_valid = old_cursor->next();
+        }
+        else
+        {
+            if (order > 0 || !same_page(*old_cursor, *new_cursor))
+            {
+                auto page = new_cursor->load();
+                written = page && store_page(store.get(), *page);
+            }
+            old_valid = order == 0 ? old_cursor->next() : old_valid;
+            new_valid = new_cursor->next();
+        }
+        if (!written)
+        {
+            throw std::runtime_error("Failed to write patch: " + patch_path);
+        }
+    }
+
+    sqlite3_prepare_v2(db.get(), "INSERT INTO hyperpage_base (fingerprint) VALUES (?);", -1, &stmt, nullptr);
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> base(stmt, &sqlite3_finalize);
+    const std::string fingerprint = fingerprint_string(base_hash);
+    sqlite3_bind_text(stmt, 1, fingerprint.c_str(), -1, SQLITE_STATIC);
+    if (!sqlite_call(SQLITE_DONE, sqlite3_step, stmt) ||
+        !sqlite_call(SQLITE_OK, sqlite3_exec, db.get(), "COMMIT;", nullptr, nullptr, nullptr))
+    {
+        throw std::runtime_error("Failed to write patch: " + patch_path);
+    }
+}
+
+void hyperpage::diff(const std::string &old_db_path, const std::string &new_db_path, const std::string &patch_path)
+{
+    for (const std::string &db_path : {old_db_path, new_db_path})
+    {
+        if (!std::filesystem::is_regular_file(db_path))
+        {
+            throw std::runtime_error("Failed to open database: " + db_path);
+        }
+    }
+    // the patch is written next to its destination and renamed into place
+    // once complete, so neither path may alias one of the inputs
+    const std::string temp_path = patch_path + ".tmp";
+    for (const std::string &output_path : {patch_path, temp_path})
+    {
+        for (const std::string &db_path : {old_db_path, new_db_path})
+        {
+            if (std::filesystem::exists(output_path) && std::filesystem::equivalent(output_path, db_path))
+            {
+                throw std::invalid_argument("Patch would overwrite its input: " + output_path);
+            }
+        }
+    }
+    std::filesystem::remove(temp_path);
+
+    try
+    {
+        write_patch(old_db_path, new_db_path, temp_path);
+    }
+    catch (...)
+    {
+        std::filesystem::remove(temp_path);
+        throw;
+    }
+    std::filesystem::rename(temp_path, patch_path);
+}
+
+void hyperpage::apply(const std::string &patch_path, hyperpage::writer &target)
+{
+    if (!std::filesystem::is_regular_file(patch_path))
+    {
+        throw std::runtime_error("Failed to open patch: " + patch_path);
+    }
+
+    auto db = open_patch(patch_path);
+    sqlite3_stmt *stmt = nullptr;
+    const bool has_base = sqlite_call(SQLITE_OK, sqlite3_prepare_v2, db.get(), "SELECT fingerprint FROM hyperpage_base;", -1, &stmt, nullptr) &&
+                          sqlite_call(SQLITE_ROW, sqlite3_step, stmt);
+    const std::string fingerprint = has_base ? reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)) : "";
     sqlite3_finalize(stmt);
+    const bool valid = has_base && sqlite_call(SQLITE_OK, sqlite3_prepare_v2, db.get(), "SELECT path FROM hyperpage_removed;", -1, &stmt, nullptr);
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> removed(valid ? stmt : nullptr, &sqlite3_finalize);
+    if (!valid)
+    {
+        throw std::runtime_error("Invalid patch: " + patch_path);
+    }
+    hyperpage::reader patch(patch_path);
+    auto cursor = patch.list();
+
+    // a single transaction keeps readers and failed applies from ever
+    // seeing a partially patched database
+    target.begin();
+    try
+    {
+        // checked inside the transaction so the base cannot change between
+        // the check and the update
+        if (archive_fingerprint(get_handle(target._handle)) != fingerprint)
+        {
+            throw std::runtime_error("Patch was not created from this database: " + patch_path);
+        }
+        int rc;
+        while ((rc = sqlite3_step(removed.get())) == SQLITE_ROW)
+        {
+            target.remove(reinterpret_cast<const char *>(sqlite3_column_text(removed.get(), 0)));
+        }
+        if (rc != SQLITE_DONE)
+        {
+            throw std::runtime_error("Failed to read patch: " + patch_path);
+        }
+        while (cursor->next())
+        {
+            auto page = cursor->load();
+            if (!page)
+            {
+                throw std::runtime_error("Failed to read patch: " + patch_path);
+            }
+            target.store(*page);
+        }
+        target.commit();
+    }
+    catch (...)
+    {
+        target.rollback();
+        throw;
+    }
+}
+
+static const char *const manifest_header = "hyperpage-manifest 1";
+
+static const char *strategy_name(hyperpage::shard_strategy strategy)
+{
+    return strategy == hyperpage::shard_strategy::top_directory ? "top_directory" : "path_hash";
+}
+
+static size_t shard_index(hyperpage::shard_strategy strategy, const std::string &page_path, size_t shard_count)
+{
+    std::string_view key(page_path);
+    if (strategy == hyperpage::shard_strategy::top_directory)
+    {
+        // pages in the root directory share the empty key
+        const size_t start = key.empty() || key.front() != '/' ? 0 : 1;
+        const size_t separator = key.find('/', start);
+        key = separator == std::string_view::npos ? std::string_view() : key.substr(0, separator);
+    }
+    return static_cast<size_t>(fnv1a_hash(key) % shard_count);
+}
+
+hyperpage::sharded_writer::sharded_writer(const std::string &manifest_path, size_t shard_count, shard_strategy strategy) : _manifest_path(manifest_path),
+                                                                                                                           _strategy(strategy)
+{
+    if (shard_count == 0)
+    {
+        throw std::invalid_argument("Shard count must be at least 1");
+    }
+    const std::filesystem::path manifest(manifest_path);
+    const std::string stem = manifest.stem().string();
+    std::filesystem::remove(manifest);
+    for (size_t index = 0; index < shard_count; index++)
+    {
+        _files.push_back(stem + "." + std::to_string(index) + ".db");
+        _shards.push_back(std::make_unique<hyperpage::writer>((manifest.parent_path() / _files.back()).string()));
+    }
+}
+
+size_t hyperpage::sharded_writer::shard_count() const
+{
+    return _files.size();
+}
+
+size_t hyperpage::sharded_writer::shard_of(const std::string &page_path) const
+{
+    return shard_index(_strategy, page_path, _files.size());
+}
+
+hyperpage::writer &hyperpage::sharded_writer::shard(size_t index)
+{
+    if (!_shards.at(index))
+    {
+        throw std::runtime_error("Shard is closed: " + _files[index]);
+    }
+    return *_shards[index];
+}
+
+void hyperpage::sharded_writer::store(const hyperpage::page &page)
+{
+    shard(shard_of(page.get_path())).store(page);
+}
+
+void hyperpage::sharded_writer::close(size_t index)
+{
+    _shards.at(index).reset();
+}
+
+void hyperpage::sharded_writer::finish()
+{
+    for (auto &shard : _shards)
+    {
+        shard.reset();
+    }
+
+    const std::string temp_path = _manifest_path + ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::trunc);
+        output << manifest_header << "\n"
+               << "strategy " << strategy_name(_strategy) << "\n";
+        for (const std::string &file : _files)
+        {
+            output << "shard " << file << "\n";
+        }
+        if (!output.flush())
+        {
+            std::filesystem::remove(temp_path);
+            throw std::runtime_error("Failed to write manifest: " + _manifest_path);
+        }
+    }
+    std::filesystem::rename(temp_path, _manifest_path);
 }
 
-std::string hyperpage::mime_type(const std::string &path)
+hyperpage::sharded_reader::sharded_reader(const std::string &manifest_path) : _strategy(shard_strategy::path_hash)
 {
-    const char *mime = getMegaMimeType(path.c_str());
-    return std::string(mime ? mime : "application/octet-stream");
+    const std::filesystem::path base = std::filesystem::path(manifest_path).parent_path();
+    std::ifstream input(manifest_path);
+    std::string line;
+    if (!input || !std::getline(input, line) || line != manifest_header)
+    {
+        throw std::runtime_error("Failed to open manifest: " + manifest_path);
+    }
+    while (std::getline(input, line))
+    {
+        const size_t separator = line.find(' ');
+        const std::string key = line.substr(0, separator);
+        const std::string value = separator == std::string::npos ? std::string() : line.substr(separator + 1);
+        if (key == "strategy" && value == strategy_name(shard_strategy::path_hash))
+        {
+            _strategy = shard_strategy::path_hash;
+        }
+        else if (key == "strategy" && value == strategy_name(shard_strategy::top_directory))
+        {
+            _strategy = shard_strategy::top_directory;
+        }
+        else if (key == "shard" && !value.empty())
+        {
+            _files.push_back((base / value).string());
+        }
+        else if (!key.empty())
+        {
+            throw std::runtime_error("Invalid manifest entry: " + line);
+        }
+    }
+    if (_files.empty())
+    {
+        throw std::runtime_error("Manifest does not list any shards: " + manifest_path);
+    }
+    _shards.resize(_files.size());
+}
+
+size_t hyperpage::sharded_reader::shard_count() const
+{
+    return _shards.size();
+}
+
+std::unique_ptr<hyperpage::page> hyperpage::sharded_reader::load(const std::string &page_path)
+{
+    const size_t index = shard_index(_strategy, page_path, _shards.size());
+    if (!_shards[index])
+    {
+        _shards[index] = std::make_unique<hyperpage::reader>(_files[index]);
+    }
+    return _shards[index]->load(page_path);
+}
+
+bool hyperpage::sharded_reader::shard_open(size_t index) const
+{
+    return _shards.at(index) != nullptr;
+}
+
+std::string_view hyperpage::mime_type(const std::string &path)
+{
+    std::string_view result = default_mime_type;
+    const std::string extension = normalize_extension(file_extension(path));
+    bool overridden = false;
+    if (!extension.empty())
+    {
+        mime_registry &registry = get_mime_registry();
+        if (registry.active.load(std::memory_order_acquire))
+        {
+            std::shared_lock<std::shared_mutex> lock(registry.mutex);
+            auto it = registry.overrides.find(extension);
+            if (it != registry.overrides.end())
+            {
+                result = it->second;
+                overridden = true;
+            }
+        }
+        if (!overridden)
+        {
+            auto it = std::lower_bound(mime_table.begin(), mime_table.end(), std::string_view(extension),
+                                       [](const mime_entry &entry, std::string_view key)
+                                       {
+                                           return entry.extension < key;
+                                       });
+            if (it != mime_table.end() && it->extension == extension)
+            {
+                result = it->mime_type;
+            }
+            else
+            {
+                result = fallback_mime_type(extension);
+            }
+        }
+    }
+    return result;
+}
+
+void hyperpage::set_mime_type(const std::string &extension, const std::string &mime_type)
+{
+    std::string_view trimmed(extension);
+    if (!trimmed.empty() && trimmed.front() == '.')
+    {
+        trimmed.remove_prefix(1);
+    }
+    const std::string key = normalize_extension(trimmed);
+    if (key.empty())
+    {
+        throw std::invalid_argument("Invalid file extension: " + extension);
+    }
+    mime_registry &registry = get_mime_registry();
+    std::unique_lock<std::shared_mutex> lock(registry.mutex);
+    const std::string_view interned = *registry.interned.insert(mime_type).first;
+    registry.overrides[key] = interned;
+    registry.active.store(true, std::memory_order_release);
 }
\ No newline at end of file
@@ -33,6 +33,8 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace hyperpage
 {
@@ -45,6 +47,11 @@ namespace hyperpage
     class page
     {
     public:
+        /**
+         *  @brief destroys the page.
+         */
+        virtual ~page() = default;
+
         /**
          *  @brief gets the URI path of the page.
          */
@@ -70,6 +77,76 @@ namespace hyperpage
         virtual size_t get_length() const = 0;
     };
 
+    /**
+     *  @brief cursor
+     *
+     *  @class class for iterating over the pages of a hyperpage database
+     *  in path order. Page content is only loaded on request. A cursor
+     *  must not outlive the reader that created it.
+     */
+    class cursor
+    {
+    public:
+        /**
+         *  @brief Advances the cursor to the next page.
+         *
+         *  @return true if the cursor points to a page, false once all
+         *  pages have been visited.
+         */
+        bool next();
+
+        /**
+         *  @brief gets the URI path of the current page.
+         */
+        const std::string &get_path() const;
+
+        /**
+         *  @brief gets the MIME type of the current page.
+         */
+        const std::string &get_mime_type() const;
+
+        /**
+         *  @brief gets the content length of the current page.
+         *
+         *  @return the length of the content in bytes.
+         */
+        size_t get_length() const;
+
+        /**
+         *  @brief Loads the current page, including its content.
+         *
+         *  @return A unique pointer to the loaded page.
+         */
+        std::unique_ptr<page> load() const;
+
+    private:
+        friend class reader;
+        cursor(void *db, const std::string &prefix);
+        void *_db;
+        std::unique_ptr<void, std::function<void(void *)>> _stmt;
+        std::string _path;
+        std::string _mime_type;
+        size_t _length;
+    };
+
+    /**
+     *  @brief resolve_options
+     *
+     *  @struct rules used by reader::resolve() to map request paths to
+     *  pages.
+     */
+    struct resolve_options
+    {
+        /** page served for directory paths, empty to disable */
+        std::string index_file = "index.html";
+
+        /** serve /name.html for the extensionless path /name */
+        bool html_extension = true;
+
+        /** page served for unmatched extensionless paths, empty to disable */
+        std::string fallback;
+    };
+
     /**
      *  @brief reader
      *
@@ -93,8 +170,45 @@ namespace hyperpage
          */
         std::unique_ptr<page> load(const std::string &page_path);
 
+        /**
+         *  @brief Lists the pages in the hyperpage database in path order.
+         *
+         *  @param prefix Only pages whose path starts with this prefix are
+         *  listed. An empty prefix lists every page.
+         *  @return A cursor positioned before the first matching page.
+         */
+        std::unique_ptr<cursor> list(const std::string &prefix = "");
+
+        /**
+         *  @brief Sets the rules used by resolve().
+         *
+         *  Routes derived from the rules, such as directory index files and
+         *  extensionless .html pages, are compiled into a table. Only paths
+         *  are read, and only routes that differ from a stored page are
+         *  kept. Changes to the database made after this call are not
+         *  reflected in the derived routes.
+         *
+         *  @param options The rules to apply.
+         */
+        void configure(const resolve_options &options);
+
+        /**
+         *  @brief Resolves a request path to a page and loads it.
+         *
+         *  The path is percent-decoded and normalized before being matched
+         *  against the rules set by configure(), which must be called
+         *  first. Paths containing control bytes, such as "%00", never
+         *  resolve. Derived routes and stored pages cost a single lookup;
+         *  only the fallback costs a second one.
+         *
+         *  @param request_path The path from the request URI.
+         *  @return A unique pointer to the loaded page, or nullptr if not found.
+         */
+        std::unique_ptr<page> resolve(const std::string &request_path);
+
     private:
         std::unique_ptr<void, std::function<void(void *)>> _handle;
+        std::unique_ptr<void, std::function<void(void *)>> _routes;
     };
 
     /**
@@ -119,11 +233,218 @@ namespace hyperpage
          */
         void store(const page &page);
 
+        /**
+         *  @brief Removes a page from the hyperpage database.
+         *
+         *  @param page_path The path of the page to remove.
+         */
+        void remove(const std::string &page_path);
+
+        /**
+         *  @brief Begins a transaction.
+         *
+         *  Pages stored or removed until commit() are only visible to
+         *  readers once the transaction is committed.
+         */
+        void begin();
+
+        /**
+         *  @brief Commits the current transaction.
+         */
+        void commit();
+
+        /**
+         *  @brief Rolls back the current transaction, if there is one.
+         */
+        void rollback();
+
     private:
+        friend void apply(const std::string &patch_path, writer &target);
+
         std::unique_ptr<void, std::function<void(void *)>> _handle;
     };
 
-    std::string mime_type(const std::string &path);
+    /**
+     *  @brief Writes a patch describing the changes between two hyperpage
+     *  databases.
+     *
+     *  The patch is itself a hyperpage database holding the added and
+     *  changed pages, along with the paths of removed pages. It is written
+     *  to a temporary file and renamed to patch_path once complete, and a
+     *  patch_path that refers to either input is rejected.
+     *
+     *  @param old_db_path The path to the original hyperpage database.
+     *  @param new_db_path The path to the updated hyperpage database.
+     *  @param patch_path The path of the patch file to create.
+     */
+    void diff(const std::string &old_db_path, const std::string &new_db_path, const std::string &patch_path);
+
+    /**
+     *  @brief Applies a patch created by diff() to a hyperpage database.
+     *
+     *  The patch is applied in a single transaction, so the database is
+     *  left unchanged if applying fails. The patch records a fingerprint
+     *  of the paths, MIME types and lengths in the database it was made
+     *  from, and applying it to any other database throws.
+     *
+     *  @param patch_path The path to the patch file.
+     *  @param target The writer for the database to update.
+     */
+    void apply(const std::string &patch_path, writer &target);
+
+    /**
+     *  @brief shard_strategy
+     *
+     *  @enum strategies for assigning pages to the shards of a sharded
+     *  archive.
+     */
+    enum class shard_strategy
+    {
+        /** pages are assigned by a hash of their full path */
+        path_hash,
+        /** pages are assigned by a hash of their top-level directory */
+        top_directory
+    };
+
+    /**
+     *  @brief sharded_writer
+     *
+     *  @class class for storing pages in an archive split across several
+     *  hyperpage database files, described by a manifest file.
+     */
+    class sharded_writer
+    {
+    public:
+        /**
+         *  @brief Constructs a writer for a sharded archive.
+         *
+         *  Shard databases are created next to the manifest as
+         *  <stem>.<index>.db. Any existing manifest is removed, and the new
+         *  one is only written by finish(), so an interrupted write never
+         *  leaves a manifest pointing at partial shards.
+         *
+         *  @param manifest_path The path to the manifest file.
+         *  @param shard_count The number of shards, must be at least 1.
+         *  @param strategy The strategy used to assign pages to shards.
+         */
+        sharded_writer(const std::string &manifest_path, size_t shard_count,
+                       shard_strategy strategy = shard_strategy::path_hash);
+
+        /**
+         *  @brief gets the number of shards in the archive.
+         */
+        size_t shard_count() const;
+
+        /**
+         *  @brief Determines which shard a page belongs to.
+         *
+         *  @param page_path The path of the page.
+         *  @return The index of the shard that stores the page.
+         */
+        size_t shard_of(const std::string &page_path) const;
+
+        /**
+         *  @brief gets the writer for a single shard.
+         *
+         *  Writers for different shards may be used concurrently.
+         *
+         *  @param index The index of the shard.
+         *  @return The writer for the shard.
+         */
+        writer &shard(size_t index);
+
+        /**
+         *  @brief Stores a page in the shard it belongs to.
+         *
+         *  @param page The page to store.
+         */
+        void store(const page &page);
+
+        /**
+         *  @brief Closes a single shard once all of its pages are stored.
+         *
+         *  Closing compacts the shard database, so calling this from the
+         *  thread that wrote the shard lets shards compact in parallel.
+         *
+         *  @param index The index of the shard.
+         */
+        void close(size_t index);
+
+        /**
+         *  @brief Closes any open shards and writes the manifest.
+         *
+         *  The manifest is written to a temporary file and renamed into
+         *  place, so readers only ever see a complete manifest.
+         */
+        void finish();
+
+    private:
+        std::string _manifest_path;
+        std::vector<std::string> _files;
+        shard_strategy _strategy;
+        std::vector<std::unique_ptr<writer>> _shards;
+    };
+
+    /**
+     *  @brief sharded_reader
+     *
+     *  @class class for loading pages from a sharded archive. Shards are
+     *  opened the first time a page is loaded from them.
+     */
+    class sharded_reader
+    {
+    public:
+        /**
+         *  @brief Constructs a reader for a sharded archive.
+         *
+         *  @param manifest_path The path to the manifest file.
+         */
+        sharded_reader(const std::string &manifest_path);
+
+        /**
+         *  @brief gets the number of shards in the archive.
+         */
+        size_t shard_count() const;
+
+        /**
+         *  @brief Loads a page from the shard it belongs to.
+         *
+         *  @param page_path The path of the page to load.
+         *  @return A unique pointer to the loaded page, or nullptr if not found.
+         */
+        std::unique_ptr<page> load(const std::string &page_path);
+
+        /**
+         *  @brief Determines whether a shard has been opened.
+         *
+         *  @param index The index of the shard.
+         *  @return true once a page has been loaded from the shard.
+         */
+        bool shard_open(size_t index) const;
+
+    private:
+        shard_strategy _strategy;
+        std::vector<std::string> _files;
+        std::vector<std::unique_ptr<reader>> _shards;
+    };
+
+    /**
+     *  @brief Determines the MIME type of a file from its extension.
+     *
+     *  @param path The path or file name to inspect.
+     *  @return The MIME type for the extension, or "application/octet-stream"
+     *  if the extension is not recognized. The returned view remains valid
+     *  for the lifetime of the program.
+     */
+    std::string_view mime_type(const std::string &path);
+
+    /**
+     *  @brief Overrides the MIME type reported for a file extension.
+     *
+     *  @param extension The extension, with or without the leading dot.
+     *  @param mime_type The MIME type to report for the extension.
+     */
+    void set_mime_type(const std::string &extension, const std::string &mime_type);
 }
 
 #endif
\ No newline at end of file
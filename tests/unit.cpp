@@ -24,6 +24,9 @@
 
 #include <maxtest.hpp>
 
+#include <sqlite3.h>
+
+#include <algorithm>
 #include <filesystem>
 
 class test_page : public hyperpage::page
@@ -145,6 +148,45 @@ MAXTEST_MAIN
 
         auto file_type = hyperpage::mime_type(json_path);
         MAXTEST_ASSERT(file_type == json_mime_type);
+        MAXTEST_ASSERT(hyperpage::mime_type("/assets/INDEX.HTML") == "text/html");
+        MAXTEST_ASSERT(hyperpage::mime_type("/archive.tar.gz") == "application/gzip");
+        MAXTEST_ASSERT(hyperpage::mime_type("/v1.0/LICENSE") == "application/octet-stream");
+        MAXTEST_ASSERT(hyperpage::mime_type("/file.unknown") == "application/octet-stream");
+        MAXTEST_ASSERT(hyperpage::mime_type("/captions/en.vtt") == "text/vtt");
+        MAXTEST_ASSERT(hyperpage::mime_type("/stream/index.m3u8") == "application/vnd.apple.mpegurl");
+        MAXTEST_ASSERT(hyperpage::mime_type("/stream/manifest.mpd") == "application/dash+xml");
+        MAXTEST_ASSERT(hyperpage::mime_type("/events.ics") == "text/calendar");
+
+        // extensions outside the built-in table are resolved by MegaMimes
+        for (const std::string path : {"/src/App.jsx", "/src/App.tsx", "/scripts/build.py"})
+        {
+            const std::string_view fallback_type = hyperpage::mime_type(path);
+            MAXTEST_ASSERT(fallback_type != "application/octet-stream");
+            MAXTEST_ASSERT(hyperpage::mime_type(path).data() == fallback_type.data());
+        }
+    };
+
+    MAXTEST_TEST_CASE(mime_type_override)
+    {
+        bool exception_thrown = false;
+
+        hyperpage::set_mime_type(".hpx", "application/x-hyperpage");
+        MAXTEST_ASSERT(hyperpage::mime_type("page.HPX") == "application/x-hyperpage");
+
+        hyperpage::set_mime_type("json", "application/vnd.api+json");
+        MAXTEST_ASSERT(hyperpage::mime_type("test.json") == "application/vnd.api+json");
+        hyperpage::set_mime_type("json", "application/json");
+        MAXTEST_ASSERT(hyperpage::mime_type("test.json") == "application/json");
+
+        try
+        {
+            hyperpage::set_mime_type(".", "text/plain");
+        }
+        catch(...)
+        {
+            exception_thrown = true;
+        }
+        MAXTEST_ASSERT(exception_thrown);
     };
 
     MAXTEST_TEST_CASE(overwrite_test)
@@ -222,4 +264,441 @@ MAXTEST_MAIN
         MAXTEST_ASSERT(match_buffers(loaded_page->get_content(), loaded_page->get_length(),
                                     reinterpret_cast<const uint8_t*>(expected_content.data()), expected_content.size()));
     };
+
+    MAXTEST_TEST_CASE(sharded_store_load)
+    {
+        std::filesystem::path manifest_path = std::filesystem::path(args[0]) / "hyperpage_sharded_test.hpm";
+        const std::vector<std::string> paths = {
+            "/index.html", "/docs/index.html", "/docs/guide.html", "/media/logo.png", "/media/video.mp4"};
+
+        {
+            hyperpage::sharded_writer writer(manifest_path.string(), 3, hyperpage::shard_strategy::top_directory);
+            MAXTEST_ASSERT(writer.shard_count() == 3);
+            MAXTEST_ASSERT(writer.shard_of("/docs/index.html") == writer.shard_of("/docs/guide.html"));
+            for (const std::string &path : paths)
+            {
+                writer.store(test_page(path, "text/plain", "content of " + path));
+            }
+            MAXTEST_ASSERT(!std::filesystem::exists(manifest_path));
+            writer.finish();
+        }
+
+        for (size_t index = 0; index < 3; index++)
+        {
+            MAXTEST_ASSERT(std::filesystem::exists(manifest_path.parent_path() /
+                                                   ("hyperpage_sharded_test." + std::to_string(index) + ".db")));
+        }
+
+        hyperpage::sharded_reader reader(manifest_path.string());
+        MAXTEST_ASSERT(reader.shard_count() == 3);
+        for (const std::string &path : paths)
+        {
+            const std::string expected_content = "content of " + path;
+            auto loaded_page = reader.load(path);
+            MAXTEST_ASSERT(loaded_page != nullptr);
+            MAXTEST_ASSERT(loaded_page->get_path() == path);
+            MAXTEST_ASSERT(match_buffers(loaded_page->get_content(), loaded_page->get_length(),
+                                        reinterpret_cast<const uint8_t*>(expected_content.data()), expected_content.size()));
+        }
+        MAXTEST_ASSERT(reader.load("/docs/missing.html") == nullptr);
+
+        bool exception_thrown = false;
+        try
+        {
+            hyperpage::sharded_reader invalid_reader((std::filesystem::path(args[0]) / "hyperpage_test.db").string());
+        }
+        catch(...)
+        {
+            exception_thrown = true;
+        }
+        MAXTEST_ASSERT(exception_thrown);
+    };
+
+    MAXTEST_TEST_CASE(sharded_path_hash)
+    {
+        std::filesystem::path manifest_path = std::filesystem::path(args[0]) / "hyperpage_hash_test.hpm";
+        std::vector<std::string> paths;
+        for (size_t index = 0; index < 32; index++)
+        {
+            paths.push_back("/docs/page" + std::to_string(index) + ".html");
+        }
+
+        std::vector<size_t> owners;
+        {
+            hyperpage::sharded_writer writer(manifest_path.string(), 4);
+            for (const std::string &path : paths)
+            {
+                owners.push_back(writer.shard_of(path));
+                writer.store(test_page(path, "text/html", "content of " + path));
+            }
+            writer.finish();
+        }
+
+        // pages in the same directory are spread over the shards by path
+        MAXTEST_ASSERT(std::count(owners.begin(), owners.end(), owners.front()) < static_cast<long>(owners.size()));
+        for (size_t index = 0; index < paths.size(); index++)
+        {
+            const std::string shard_path = (manifest_path.parent_path() /
+                                            ("hyperpage_hash_test." + std::to_string(owners[index]) + ".db")).string();
+            hyperpage::reader shard(shard_path);
+            MAXTEST_ASSERT(shard.load(paths[index]) != nullptr);
+        }
+
+        hyperpage::sharded_reader reader(manifest_path.string());
+        MAXTEST_ASSERT(reader.shard_count() == 4);
+        for (size_t index = 0; index < 4; index++)
+        {
+            MAXTEST_ASSERT(!reader.shard_open(index));
+        }
+
+        // only the shard that owns the page is opened
+        auto loaded_page = reader.load(paths.front());
+        MAXTEST_ASSERT(loaded_page != nullptr);
+        for (size_t index = 0; index < 4; index++)
+        {
+            MAXTEST_ASSERT(reader.shard_open(index) == (index == owners.front()));
+        }
+
+        for (const std::string &path : paths)
+        {
+            loaded_page = reader.load(path);
+            MAXTEST_ASSERT(loaded_page != nullptr);
+            MAXTEST_ASSERT(loaded_page->get_path() == path);
+        }
+    };
+
+    MAXTEST_TEST_CASE(list_pages)
+    {
+        std::filesystem::path db_path = std::filesystem::path(args[0]) / "hyperpage_list_test.db";
+
+        if (std::filesystem::exists(db_path)) {
+            std::filesystem::remove(db_path);
+        }
+
+        {
+            hyperpage::writer writer(db_path.string());
+            writer.store(test_page("/docs/b.html", "text/html", "<p>b</p>"));
+            writer.store(test_page("/index.html", "text/html", "<p>index</p>"));
+            writer.store(test_page("/docs/a.html", "text/html", "<p>a</p>"));
+            writer.store(test_page("/docs-old/a.html", "text/html", "<p>old</p>"));
+            writer.store(test_page("/docs/img/c.png", "image/png", "png"));
+        }
+
+        hyperpage::reader reader(db_path.string());
+        std::vector<std::string> paths;
+        auto cursor = reader.list();
+        while (cursor->next())
+        {
+            paths.push_back(cursor->get_path());
+        }
+        MAXTEST_ASSERT((paths == std::vector<std::string>{
+            "/docs-old/a.html", "/docs/a.html", "/docs/b.html", "/docs/img/c.png", "/index.html"}));
+
+        paths.clear();
+        cursor = reader.list("/docs/");
+        while (cursor->next())
+        {
+            paths.push_back(cursor->get_path());
+        }
+        MAXTEST_ASSERT((paths == std::vector<std::string>{"/docs/a.html", "/docs/b.html", "/docs/img/c.png"}));
+
+        cursor = reader.list("/docs/img/");
+        MAXTEST_ASSERT(cursor->next());
+        MAXTEST_ASSERT(cursor->get_mime_type() == "image/png");
+        MAXTEST_ASSERT(cursor->get_length() == 3);
+        auto loaded_page = cursor->load();
+        MAXTEST_ASSERT(loaded_page != nullptr);
+        MAXTEST_ASSERT(match_buffers(loaded_page->get_content(), loaded_page->get_length(),
+                                    reinterpret_cast<const uint8_t*>("png"), 3));
+        MAXTEST_ASSERT(!cursor->next());
+
+        cursor = reader.list("/missing/");
+        MAXTEST_ASSERT(!cursor->next());
+    };
+
+    MAXTEST_TEST_CASE(diff_apply)
+    {
+        const std::filesystem::path base = std::filesystem::path(args[0]);
+        const std::filesystem::path old_path = base / "hyperpage_diff_old.db";
+        const std::filesystem::path new_path = base / "hyperpage_diff_new.db";
+        const std::filesystem::path patch_path = base / "hyperpage_diff.patch";
+
+        for (const auto &path : {old_path, new_path})
+        {
+            if (std::filesystem::exists(path)) {
+                std::filesystem::remove(path);
+            }
+        }
+
+        {
+            hyperpage::writer old_writer(old_path.string());
+            old_writer.store(test_page("/index.html", "text/html", "<p>index</p>"));
+            old_writer.store(test_page("/removed.html", "text/html", "<p>removed</p>"));
+            old_writer.store(test_page("/changed.css", "text/css", "body { color: red; }"));
+            old_writer.store(test_page("/retyped.txt", "text/plain", "retyped"));
+
+            hyperpage::writer new_writer(new_path.string());
+            new_writer.store(test_page("/index.html", "text/html", "<p>index</p>"));
+            new_writer.store(test_page("/changed.css", "text/css", "body { color: blu; }"));
+            new_writer.store(test_page("/retyped.txt", "text/markdown", "retyped"));
+            new_writer.store(test_page("/added.js", "text/javascript", "console.log(1);"));
+        }
+
+        hyperpage::diff(old_path.string(), new_path.string(), patch_path.string());
+
+        {
+            // the patch only carries added and changed pages
+            hyperpage::reader patch(patch_path.string());
+            std::vector<std::string> paths;
+            auto cursor = patch.list();
+            while (cursor->next())
+            {
+                paths.push_back(cursor->get_path());
+            }
+            MAXTEST_ASSERT((paths == std::vector<std::string>{"/added.js", "/changed.css", "/retyped.txt"}));
+        }
+
+        {
+            hyperpage::writer target(old_path.string());
+            hyperpage::apply(patch_path.string(), target);
+        }
+
+        hyperpage::reader patched(old_path.string());
+        hyperpage::reader expected(new_path.string());
+        auto patched_cursor = patched.list();
+        auto expected_cursor = expected.list();
+        while (expected_cursor->next())
+        {
+            MAXTEST_ASSERT(patched_cursor->next());
+            MAXTEST_ASSERT(patched_cursor->get_path() == expected_cursor->get_path());
+            MAXTEST_ASSERT(patched_cursor->get_mime_type() == expected_cursor->get_mime_type());
+            auto patched_page = patched_cursor->load();
+            auto expected_page = expected_cursor->load();
+            MAXTEST_ASSERT(match_buffers(patched_page->get_content(), patched_page->get_length(),
+                                        expected_page->get_content(), expected_page->get_length()));
+        }
+        MAXTEST_ASSERT(!patched_cursor->next());
+
+        bool exception_thrown = false;
+        try
+        {
+            hyperpage::writer target(old_path.string());
+            hyperpage::apply(new_path.string(), target);
+        }
+        catch(...)
+        {
+            exception_thrown = true;
+        }
+        MAXTEST_ASSERT(exception_thrown);
+
+        // the patch only applies to the archive it was made from, so applying
+        // it again or to another archive is rejected without changes
+        for (const auto &path : {old_path, new_path})
+        {
+            {
+                hyperpage::writer target(path.string());
+                target.store(test_page("/extra.html", "text/html", "<p>extra</p>"));
+            }
+            exception_thrown = false;
+            try
+            {
+                hyperpage::writer target(path.string());
+                hyperpage::apply(patch_path.string(), target);
+            }
+            catch(...)
+            {
+                exception_thrown = true;
+            }
+            MAXTEST_ASSERT(exception_thrown);
+            hyperpage::reader unchanged(path.string());
+            MAXTEST_ASSERT(unchanged.load("/removed.html") == nullptr);
+            MAXTEST_ASSERT(unchanged.load("/extra.html") != nullptr);
+        }
+    };
+
+    MAXTEST_TEST_CASE(diff_aliased_patch)
+    {
+        const std::filesystem::path base = std::filesystem::path(args[0]);
+        const std::filesystem::path old_path = base / "hyperpage_alias_old.db";
+        const std::filesystem::path new_path = base / "hyperpage_alias_new.db";
+
+        for (const auto &path : {old_path, new_path})
+        {
+            if (std::filesystem::exists(path)) {
+                std::filesystem::remove(path);
+            }
+        }
+
+        {
+            hyperpage::writer old_writer(old_path.string());
+            old_writer.store(test_page("/index.html", "text/html", "<p>index</p>"));
+            old_writer.store(test_page("/about.html", "text/html", "<p>about</p>"));
+
+            hyperpage::writer new_writer(new_path.string());
+            new_writer.store(test_page("/index.html", "text/html", "<p>index v2</p>"));
+        }
+
+        // a patch path naming either input, even through a different
+        // spelling of the path, is rejected before anything is written
+        const std::string aliases[] = {old_path.string(), new_path.string(),
+                                       (base / "." / "hyperpage_alias_old.db").string()};
+        for (const std::string &alias : aliases)
+        {
+            bool exception_thrown = false;
+            try
+            {
+                hyperpage::diff(old_path.string(), new_path.string(), alias);
+            }
+            catch(...)
+            {
+                exception_thrown = true;
+            }
+            MAXTEST_ASSERT(exception_thrown);
+        }
+
+        hyperpage::reader old_reader(old_path.string());
+        auto cursor = old_reader.list();
+        size_t count = 0;
+        while (cursor->next())
+        {
+            count++;
+        }
+        MAXTEST_ASSERT(count == 2);
+        auto index_page = old_reader.load("/index.html");
+        MAXTEST_ASSERT(index_page != nullptr);
+        MAXTEST_ASSERT(index_page->get_length() == std::string("<p>index</p>").size());
+        MAXTEST_ASSERT(!std::filesystem::exists(old_path.string() + ".tmp"));
+    };
+
+    MAXTEST_TEST_CASE(resolve_pages)
+    {
+        std::filesystem::path db_path = std::filesystem::path(args[0]) / "hyperpage_resolve_test.db";
+
+        if (std::filesystem::exists(db_path)) {
+            std::filesystem::remove(db_path);
+        }
+
+        {
+            hyperpage::writer writer(db_path.string());
+            writer.store(test_page("/index.html", "text/html", "root"));
+            writer.store(test_page("/docs/index.html", "text/html", "docs"));
+            writer.store(test_page("/about.html", "text/html", "about"));
+            writer.store(test_page("/about", "text/plain", "about file"));
+            writer.store(test_page("/contact.html", "text/html", "contact"));
+            writer.store(test_page("/hello world.txt", "text/plain", "hello"));
+            writer.store(test_page("/secret.txt", "text/plain", "secret"));
+        }
+
+        hyperpage::reader reader(db_path.string());
+        auto resolved_path = [&](const std::string &request_path)
+        {
+            auto page = reader.resolve(request_path);
+            return page ? page->get_path() : std::string();
+        };
+
+        bool exception_thrown = false;
+        try
+        {
+            reader.resolve("/");
+        }
+        catch(...)
+        {
+            exception_thrown = true;
+        }
+        MAXTEST_ASSERT(exception_thrown);
+
+        reader.configure(hyperpage::resolve_options());
+
+        MAXTEST_ASSERT(resolved_path("/") == "/index.html");
+        MAXTEST_ASSERT(resolved_path("") == "/index.html");
+        MAXTEST_ASSERT(resolved_path("/docs") == "/docs/index.html");
+        MAXTEST_ASSERT(resolved_path("/docs/") == "/docs/index.html");
+        MAXTEST_ASSERT(resolved_path("//docs/./guide/../") == "/docs/index.html");
+        MAXTEST_ASSERT(resolved_path("/about") == "/about");
+        MAXTEST_ASSERT(resolved_path("/contact") == "/contact.html");
+        MAXTEST_ASSERT(resolved_path("/hello%20world.txt") == "/hello world.txt");
+        MAXTEST_ASSERT(resolved_path("/index.html?query=1") == "/index.html");
+        MAXTEST_ASSERT(resolved_path("/app/settings").empty());
+
+        // decoded control bytes never match a page, so "%00" cannot cut a
+        // path short inside sqlite
+        MAXTEST_ASSERT(resolved_path("/secret.txt") == "/secret.txt");
+        MAXTEST_ASSERT(resolved_path("/secret.txt%00.png").empty());
+        MAXTEST_ASSERT(resolved_path("/secret.txt%00").empty());
+        MAXTEST_ASSERT(resolved_path("/secret%0A.txt").empty());
+        MAXTEST_ASSERT(resolved_path(std::string("/secret.txt\0.png", 15)).empty());
+        MAXTEST_ASSERT(reader.load(std::string("/secret.txt\0.png", 15)) == nullptr);
+
+        hyperpage::resolve_options options;
+        options.html_extension = false;
+        options.fallback = "/index.html";
+        reader.configure(options);
+
+        MAXTEST_ASSERT(resolved_path("/docs/") == "/docs/index.html");
+        MAXTEST_ASSERT(resolved_path("/app/settings") == "/index.html");
+        MAXTEST_ASSERT(resolved_path("/contact") == "/index.html");
+        MAXTEST_ASSERT(resolved_path("/missing.js").empty());
+        MAXTEST_ASSERT(resolved_path("/app%00").empty());
+
+        reader.configure(hyperpage::resolve_options());
+        MAXTEST_ASSERT(resolved_path("/about/") == "/about");
+        MAXTEST_ASSERT(resolved_path("/app/settings").empty());
+    };
+
+    MAXTEST_TEST_CASE(apply_rollback)
+    {
+        const std::filesystem::path base = std::filesystem::path(args[0]);
+        const std::filesystem::path old_path = base / "hyperpage_rollback_old.db";
+        const std::filesystem::path new_path = base / "hyperpage_rollback_new.db";
+        const std::filesystem::path patch_path = base / "hyperpage_rollback.patch";
+
+        for (const auto &path : {old_path, new_path})
+        {
+            if (std::filesystem::exists(path)) {
+                std::filesystem::remove(path);
+            }
+        }
+
+        {
+            hyperpage::writer old_writer(old_path.string());
+            old_writer.store(test_page("/index.html", "text/html", "<p>old</p>"));
+            old_writer.store(test_page("/removed.html", "text/html", "<p>removed</p>"));
+
+            hyperpage::writer new_writer(new_path.string());
+            new_writer.store(test_page("/index.html", "text/html", "<p>new</p>"));
+            new_writer.store(test_page("/added.html", "text/html", "<p>added</p>"));
+        }
+
+        hyperpage::diff(old_path.string(), new_path.string(), patch_path.string());
+
+        // make the last write of the patch fail
+        sqlite3 *db = nullptr;
+        MAXTEST_ASSERT(sqlite3_open(old_path.string().c_str(), &db) == SQLITE_OK);
+        MAXTEST_ASSERT(sqlite3_exec(db,
+                                    "CREATE TRIGGER reject_index BEFORE UPDATE ON hyperpage "
+                                    "WHEN NEW.path = '/index.html' BEGIN SELECT RAISE(ABORT, 'rejected'); END;",
+                                    nullptr, nullptr, nullptr) == SQLITE_OK);
+        sqlite3_close(db);
+
+        bool exception_thrown = false;
+        try
+        {
+            hyperpage::writer target(old_path.string());
+            hyperpage::apply(patch_path.string(), target);
+        }
+        catch(...)
+        {
+            exception_thrown = true;
+        }
+        MAXTEST_ASSERT(exception_thrown);
+
+        hyperpage::reader reader(old_path.string());
+        std::vector<std::string> paths;
+        auto cursor = reader.list();
+        while (cursor->next())
+        {
+            paths.push_back(cursor->get_path());
+        }
+        MAXTEST_ASSERT((paths == std::vector<std::string>{"/index.html", "/removed.html"}));
+    };
 }
\ No newline at end of file